@@ -1,15 +1,24 @@
 #include "conversion.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <turbojpeg.h>
 
+#define JPEG_MIN_SIZE 4 // SOI + EOI
+
 static tjhandle tj = NULL;
 static uint8_t *rgb_buf = NULL;
 static size_t rgb_buf_size = 0;
+static uint8_t *last_yuyv = NULL; // Last good packed frame, sent on repeat
+static size_t yuyv_size = 0;
 
 static int frame_width = 0;
 static int frame_height = 0;
 static int initialized = 0;
+static int have_good_frame = 0;
+
+static struct conversion_stats stats;
 
 void conversion_init() {
   tj = tjInitDecompress();
@@ -17,16 +26,56 @@ void conversion_init() {
     fprintf(stderr, "tjInitDecompress failed: %s\n", tjGetErrorStr());
     exit(EXIT_FAILURE);
   }
+  stats = (struct conversion_stats){0};
 }
 
 void conversion_deinit() {
   if (rgb_buf)
     free(rgb_buf);
+  if (last_yuyv)
+    free(last_yuyv);
   if (tj)
     tjDestroy(tj);
   rgb_buf = NULL;
+  last_yuyv = NULL;
   tj = NULL;
   initialized = 0;
+  have_good_frame = 0;
+}
+
+void conversion_get_stats(struct conversion_stats *out) { *out = stats; }
+
+/**
+ * Cheap pre-decode checks so truncated or driver-flagged frames are dropped
+ * before libjpeg spends any time on them. Counts the reason on rejection.
+ */
+static int validate_mjpeg(const uint8_t *jpeg_buf, size_t buf_len,
+                          const struct v4l2_buffer *info) {
+  if (info->flags & V4L2_BUF_FLAG_ERROR) {
+    stats.rejected_error_flag++;
+    return -1;
+  }
+
+  size_t size = info->bytesused;
+  if (size < JPEG_MIN_SIZE || size > buf_len) {
+    stats.rejected_bytesused++;
+    return -1;
+  }
+
+  if (jpeg_buf[0] != 0xFF || jpeg_buf[1] != 0xD8) {
+    stats.rejected_markers++;
+    return -1;
+  }
+
+  // Some UVC cameras pad the payload with zeros after EOI
+  while (size > JPEG_MIN_SIZE && jpeg_buf[size - 1] == 0x00)
+    size--;
+  if (jpeg_buf[size - 2] != 0xFF || jpeg_buf[size - 1] != 0xD9) {
+    stats.rejected_markers++;
+    return -1;
+  }
+
+  return 0;
 }
 
 static int decode_mjpeg_to_rgb(const uint8_t *jpeg_buf,
@@ -46,8 +95,15 @@ static int decode_mjpeg_to_rgb(const uint8_t *jpeg_buf,
 
     rgb_buf_size = width * height * 3; // RGB24
     rgb_buf = malloc(rgb_buf_size);
-    if (!rgb_buf) {
-      fprintf(stderr, "Failed to allocate rgb_buf\n");
+    yuyv_size = width * height * 2; // YUYV 4:2:2
+    last_yuyv = malloc(yuyv_size);
+    if (!rgb_buf || !last_yuyv) {
+      fprintf(stderr, "Failed to allocate rgb_buf / last_yuyv\n");
+      // Retried on the next frame; don't leak whichever one succeeded
+      free(rgb_buf);
+      free(last_yuyv);
+      rgb_buf = NULL;
+      last_yuyv = NULL;
       return -1;
     }
 
@@ -122,14 +178,39 @@ static void rgb_to_yuyv(uint8_t *dst) {
   }
 }
 
-void jpeg_to_yuyv(struct buffer cap_buf, struct buffer out_buf) {
+enum conversion_result jpeg_to_yuyv(struct buffer cap_buf,
+                                    const struct v4l2_buffer *cap_info,
+                                    struct buffer out_buf) {
   if (!tj) {
     fprintf(stderr, "conversion_init() not called\n");
-    return;
+    return CONVERSION_DROP;
   }
 
-  if (decode_mjpeg_to_rgb(cap_buf.start, cap_buf.length) < 0)
-    return;
+  int ret = validate_mjpeg(cap_buf.start, cap_buf.length, cap_info);
+  if (ret == 0) {
+    TRACE_FRAME(decode_begin, cap_info);
+    ret = decode_mjpeg_to_rgb(cap_buf.start, cap_info->bytesused);
+    TRACE_FRAME(decode_end, cap_info);
+    if (ret < 0)
+      stats.rejected_decode++;
+  }
 
+  if (ret < 0) {
+    TRACE_FRAME(reject, cap_info);
+    if (!have_good_frame)
+      return CONVERSION_DROP;
+    // Rejected frame: resend the last good one without re-packing
+    memcpy(out_buf.start, last_yuyv, yuyv_size);
+    stats.repeated++;
+    return CONVERSION_REPEAT;
+  }
+
+  TRACE_FRAME(pack_begin, cap_info);
   rgb_to_yuyv(out_buf.start);
+  TRACE_FRAME(pack_end, cap_info);
+
+  memcpy(last_yuyv, out_buf.start, yuyv_size);
+  have_good_frame = 1;
+  stats.converted++;
+  return CONVERSION_OK;
 }
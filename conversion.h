@@ -1,5 +1,6 @@
 #pragma once
 #include "buffer.h"
+#include <linux/videodev2.h>
 #include <stdint.h>
 
 /**
@@ -14,6 +15,27 @@
  * with conversion_init() before calling jpeg_to_yuyv().
  */
 
+/**
+ * @brief Outcome of a single jpeg_to_yuyv() call.
+ */
+enum conversion_result {
+  CONVERSION_OK = 0, ///< Frame decoded and packed into the output buffer
+  CONVERSION_REPEAT, ///< Frame rejected; last good frame copied into the output
+  CONVERSION_DROP,   ///< Frame rejected and no good frame yet; output untouched
+};
+
+/**
+ * @brief Running counters of converted, repeated and rejected frames.
+ */
+struct conversion_stats {
+  unsigned long converted;           ///< Frames decoded successfully
+  unsigned long repeated;            ///< Outputs filled with the last good frame
+  unsigned long rejected_error_flag; ///< Driver set V4L2_BUF_FLAG_ERROR
+  unsigned long rejected_bytesused;  ///< bytesused empty or beyond buffer
+  unsigned long rejected_markers;    ///< Missing SOI or EOI (truncated frame)
+  unsigned long rejected_decode;     ///< libjpeg failed on a frame that passed
+};
+
 /**
  * @brief Initialize libjpeg-turbo decoder and internal buffers.
  *
@@ -32,9 +54,24 @@ void conversion_deinit();
  * @brief Convert a captured MJPEG frame to a YUYV buffer.
  *
  * @param cap_buf  A V4L2 buffer containing the MJPEG-encoded frame.
+ * @param cap_info The dequeued v4l2_buffer describing cap_buf (bytesused,
+ *                 flags, index, sequence, timestamp).
  * @param out_buf  A V4L2 buffer (sizeimage bytes) to receive YUYV pixels.
  *
+ * Frames flagged V4L2_BUF_FLAG_ERROR, with an implausible bytesused, or
+ * missing their SOI/EOI markers are rejected before decoding. On rejection
+ * the last good frame is written to @p out_buf instead.
+ *
  * The output buffer must be sized according to:
  *     width * height * 2 (for YUYV 4:2:2)
+ *
+ * @return CONVERSION_DROP if nothing was written to @p out_buf.
+ */
+enum conversion_result jpeg_to_yuyv(struct buffer cap_buf,
+                                    const struct v4l2_buffer *cap_info,
+                                    struct buffer out_buf);
+
+/**
+ * @brief Copy the current reject / repeat counters into @p out.
  */
-void jpeg_to_yuyv(struct buffer cap_buf, struct buffer out_buf);
+void conversion_get_stats(struct conversion_stats *out);
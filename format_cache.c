@@ -0,0 +1,256 @@
+#include "format_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LINE_MAX_LEN 256
+#define FIELD_COUNT 13
+
+/*
+ * QUERYCAP strings are NUL-terminated per the V4L2 spec, so each fits in
+ * sizeof(field) - 1 characters. Copies are bounded to that and always
+ * terminated, so what is written always reads back identically.
+ */
+static void copy_str(char *dst, size_t size, const char *src) {
+  strncpy(dst, src, size - 1);
+  dst[size - 1] = '\0';
+}
+
+static int same_key(const struct format_cache_entry *a,
+                    const struct format_cache_entry *b) {
+  return a->buf_type == b->buf_type && a->req_width == b->req_width &&
+         a->req_height == b->req_height &&
+         !strncmp(a->driver, b->driver, sizeof(a->driver)) &&
+         !strncmp(a->card, b->card, sizeof(a->card)) &&
+         !strncmp(a->bus_info, b->bus_info, sizeof(a->bus_info));
+}
+
+static int same_config(const struct format_cache_entry *a,
+                       const struct format_cache_entry *b) {
+  return same_key(a, b) && a->pixelformat == b->pixelformat &&
+         a->width == b->width && a->height == b->height &&
+         a->bytesperline == b->bytesperline && a->sizeimage == b->sizeimage &&
+         a->timeperframe.numerator == b->timeperframe.numerator &&
+         a->timeperframe.denominator == b->timeperframe.denominator;
+}
+
+/*
+ * Split a tab-separated line in place. Unlike sscanf("%[^\t]"), empty fields
+ * (e.g. a driver reporting no bus_info) are kept.
+ */
+static int parse_line(char *line, struct format_cache_entry *e) {
+  char *fields[FIELD_COUNT];
+  int n = 0;
+
+  line[strcspn(line, "\n")] = '\0';
+  char *field;
+  while ((field = strsep(&line, "\t")) != NULL) {
+    if (n == FIELD_COUNT)
+      return -1;
+    fields[n++] = field;
+  }
+  if (n != FIELD_COUNT)
+    return -1;
+
+  copy_str(e->driver, sizeof(e->driver), fields[0]);
+  copy_str(e->card, sizeof(e->card), fields[1]);
+  copy_str(e->bus_info, sizeof(e->bus_info), fields[2]);
+
+  uint32_t *nums[] = {&e->buf_type,
+                      &e->req_width,
+                      &e->req_height,
+                      &e->pixelformat,
+                      &e->width,
+                      &e->height,
+                      &e->bytesperline,
+                      &e->sizeimage,
+                      &e->timeperframe.numerator,
+                      &e->timeperframe.denominator};
+  for (int i = 0; i < FIELD_COUNT - 3; ++i) {
+    char *end;
+    unsigned long v = strtoul(fields[i + 3], &end, 10);
+    if (end == fields[i + 3] || *end != '\0')
+      return -1;
+    *nums[i] = v;
+  }
+  return 0;
+}
+
+static int append(struct format_cache *cache,
+                  const struct format_cache_entry *entry) {
+  struct format_cache_entry *grown =
+      realloc(cache->entries, (cache->count + 1) * sizeof(*grown));
+  if (!grown)
+    return -1;
+  cache->entries = grown;
+  cache->entries[cache->count++] = *entry;
+  return 0;
+}
+
+void format_cache_load(const char *path, struct format_cache *cache) {
+  *cache = (struct format_cache){0};
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+
+  char line[LINE_MAX_LEN];
+  while (fgets(line, sizeof(line), f)) {
+    struct format_cache_entry e = {0};
+    if (parse_line(line, &e) < 0)
+      continue; // Ignore stale or malformed lines
+    if (append(cache, &e) < 0)
+      break;
+  }
+  fclose(f);
+}
+
+static int write_entries(FILE *f, const struct format_cache *cache) {
+  for (size_t i = 0; i < cache->count; ++i) {
+    const struct format_cache_entry *e = &cache->entries[i];
+    if (fprintf(f, "%s\t%s\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+                e->driver, e->card, e->bus_info, e->buf_type, e->req_width,
+                e->req_height, e->pixelformat, e->width, e->height,
+                e->bytesperline, e->sizeimage, e->timeperframe.numerator,
+                e->timeperframe.denominator) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * mkdir -p for the directory part of @path, so a fresh state directory works.
+ */
+static int make_parent_dirs(const char *path) {
+  char dir[PATH_MAX];
+  if (snprintf(dir, sizeof(dir), "%s", path) >= (int)sizeof(dir))
+    return -1;
+
+  for (char *p = dir + 1; *p; ++p) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return 0;
+}
+
+int format_cache_path(char *buf, size_t size) {
+  const char *env;
+  int n;
+
+  if ((env = getenv("PIPELINE_CACHE")) && *env)
+    n = snprintf(buf, size, "%s", env);
+  else if ((env = getenv("STATE_DIRECTORY")) && *env) // systemd StateDirectory=
+    n = snprintf(buf, size, "%s/%s", env, FORMAT_CACHE_FILE);
+  else if ((env = getenv("XDG_STATE_HOME")) && *env)
+    n = snprintf(buf, size, "%s/v4l2-pipeline/%s", env, FORMAT_CACHE_FILE);
+  else if ((env = getenv("HOME")) && *env)
+    n = snprintf(buf, size, "%s/.local/state/v4l2-pipeline/%s", env,
+                 FORMAT_CACHE_FILE);
+  else
+    n = snprintf(buf, size, "%s", FORMAT_CACHE_FALLBACK_PATH);
+
+  return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+int format_cache_save(const char *path,
+                      const struct format_cache_entry *entries, size_t count) {
+  char lock_path[PATH_MAX];
+  char tmp_path[PATH_MAX];
+  if (snprintf(lock_path, sizeof(lock_path), "%s.lock", path) >=
+          (int)sizeof(lock_path) ||
+      snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >=
+          (int)sizeof(tmp_path))
+    return -1;
+
+  if (make_parent_dirs(path) < 0)
+    return -1;
+
+  // The cache file itself is replaced by rename(), so lock a sidecar file
+  int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd == -1)
+    return -1;
+  if (flock(lock_fd, LOCK_EX) == -1) {
+    close(lock_fd);
+    return -1;
+  }
+
+  // Reload under the lock so entries saved by other processes are kept
+  struct format_cache cache;
+  format_cache_load(path, &cache);
+  int changed = 0;
+  for (size_t i = 0; i < count; ++i)
+    changed |= format_cache_update(&cache, &entries[i]);
+
+  int ret = 0;
+  if (changed) {
+    ret = -1;
+    int tmp_fd = mkstemp(tmp_path);
+    FILE *f = tmp_fd == -1 ? NULL : fdopen(tmp_fd, "w");
+    if (f) {
+      int write_err = write_entries(f, &cache);
+      if (fclose(f) == 0 && write_err == 0 && rename(tmp_path, path) == 0)
+        ret = 0;
+    } else if (tmp_fd != -1) {
+      close(tmp_fd);
+    }
+    if (ret < 0 && tmp_fd != -1)
+      unlink(tmp_path);
+  }
+
+  format_cache_free(&cache);
+  close(lock_fd); // Releases the flock
+  return ret;
+}
+
+void format_cache_key(struct format_cache_entry *entry,
+                      const struct v4l2_capability *caps) {
+  copy_str(entry->driver, sizeof(entry->driver), (const char *)caps->driver);
+  copy_str(entry->card, sizeof(entry->card), (const char *)caps->card);
+  copy_str(entry->bus_info, sizeof(entry->bus_info),
+           (const char *)caps->bus_info);
+}
+
+const struct format_cache_entry *
+format_cache_find(const struct format_cache *cache,
+                  const struct v4l2_capability *caps, uint32_t buf_type,
+                  uint32_t width, uint32_t height) {
+  struct format_cache_entry key = {0};
+  format_cache_key(&key, caps);
+  key.buf_type = buf_type;
+  key.req_width = width;
+  key.req_height = height;
+
+  for (size_t i = 0; i < cache->count; ++i) {
+    if (same_key(&cache->entries[i], &key))
+      return &cache->entries[i];
+  }
+  return NULL;
+}
+
+int format_cache_update(struct format_cache *cache,
+                        const struct format_cache_entry *entry) {
+  for (size_t i = 0; i < cache->count; ++i) {
+    if (same_key(&cache->entries[i], entry)) {
+      if (same_config(&cache->entries[i], entry))
+        return 0;
+      cache->entries[i] = *entry;
+      return 1;
+    }
+  }
+  return append(cache, entry) == 0;
+}
+
+void format_cache_free(struct format_cache *cache) {
+  free(cache->entries);
+  *cache = (struct format_cache){0};
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <linux/videodev2.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file format_cache.h
+ * @brief On-disk cache of negotiated device configurations.
+ *
+ * Each entry records the format and frame interval a device settled on for
+ * a given request, keyed by the VIDIOC_QUERYCAP driver / card / bus_info
+ * strings plus the buffer type and requested size. On restart init_device()
+ * compares the device's current state against the cached entry and skips
+ * S_FMT / S_PARM when it already matches.
+ *
+ * The file is plain text, one tab-separated entry per line; the QUERYCAP
+ * strings may be empty but never contain tabs. The cache is loaded before
+ * devices are brought up and saved after, so lookups during concurrent init
+ * are read-only. Several pipeline processes may share one cache file; saves
+ * are serialised with flock() and merge into what is already on disk.
+ */
+
+#define FORMAT_CACHE_FILE "device_cache"
+#define FORMAT_CACHE_FALLBACK_PATH "/var/tmp/v4l2-pipeline/device_cache"
+
+struct format_cache_entry {
+  char driver[16];   ///< v4l2_capability.driver
+  char card[32];     ///< v4l2_capability.card
+  char bus_info[32]; ///< v4l2_capability.bus_info
+  uint32_t buf_type; ///< V4L2_BUF_TYPE_* the entry was negotiated for
+  uint32_t req_width;
+  uint32_t req_height;
+
+  uint32_t pixelformat;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytesperline;
+  uint32_t sizeimage;
+  struct v4l2_fract timeperframe; ///< Zero for output devices
+};
+
+struct format_cache {
+  struct format_cache_entry *entries;
+  size_t count;
+};
+
+/**
+ * @brief Load entries from @p path. A missing or unreadable file yields an
+ * empty cache.
+ */
+void format_cache_load(const char *path, struct format_cache *cache);
+
+/**
+ * @brief Resolve the cache file path into @p buf.
+ *
+ * First match wins: $PIPELINE_CACHE, $STATE_DIRECTORY/device_cache,
+ * $XDG_STATE_HOME/v4l2-pipeline/device_cache,
+ * $HOME/.local/state/v4l2-pipeline/device_cache, then
+ * FORMAT_CACHE_FALLBACK_PATH. The result never depends on the working
+ * directory unless $PIPELINE_CACHE is relative.
+ *
+ * @return 0 on success, -1 if the path does not fit in @p size.
+ */
+int format_cache_path(char *buf, size_t size);
+
+/**
+ * @brief Merge @p entries into the cache file at @p path.
+ *
+ * Takes an exclusive flock() on "<path>.lock", reloads the file, applies
+ * @p entries with format_cache_update() and, only if anything changed,
+ * writes a mkstemp() temporary next to @p path and rename()s it into place.
+ * Missing parent directories are created.
+ *
+ * @return 0 on success (including nothing to write), -1 on failure.
+ */
+int format_cache_save(const char *path,
+                      const struct format_cache_entry *entries, size_t count);
+
+/**
+ * @brief Fill the driver / card / bus_info key of @p entry from @p caps.
+ */
+void format_cache_key(struct format_cache_entry *entry,
+                      const struct v4l2_capability *caps);
+
+/**
+ * @brief Find the entry matching a device identity and request, or NULL.
+ */
+const struct format_cache_entry *
+format_cache_find(const struct format_cache *cache,
+                  const struct v4l2_capability *caps, uint32_t buf_type,
+                  uint32_t width, uint32_t height);
+
+/**
+ * @brief Insert @p entry, replacing any entry with the same key.
+ *
+ * @return 1 if the cache changed, 0 if an identical entry was already present.
+ */
+int format_cache_update(struct format_cache *cache,
+                        const struct format_cache_entry *entry);
+
+/**
+ * @brief Release all entries.
+ */
+void format_cache_free(struct format_cache *cache);
@@ -1,12 +1,16 @@
 #include "conversion.h"
+#include "trace.h"
 #include "v4l2_helper.h"
 #include <fcntl.h>
+#include <limits.h>
 #include <linux/videodev2.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #define FRAME_DUMP_COUNT 10
+#define STATS_INTERVAL 100 // Frames between conversion stats reports
 
 /**
  * @file my_pipeline.c
@@ -45,6 +49,8 @@ void capture_frames(struct device *capture_device) {
           continue;
         errno_exit("VIDIOC_DQBUF");
       }
+      TRACE_FRAME(dqbuf, &buf);
+      note_first_frame(capture_device);
       break;
     }
 
@@ -52,14 +58,14 @@ void capture_frames(struct device *capture_device) {
     snprintf(filename, sizeof(filename), "frames/frame%d.jpg", i);
 
     int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    write(fd, capture_device->buffer[buf.index].start,
-          capture_device->buffer[buf.index].length);
+    write(fd, capture_device->buffer[buf.index].start, buf.bytesused);
     close(fd);
 
     if (!running)
       break;
 
     // Requeue buffer
+    TRACE_FRAME(qbuf, &buf);
     if (-1 == xioctl(capture_device->fd, VIDIOC_QBUF, &buf))
       errno_exit("VIDIOC_QBUF");
 
@@ -67,14 +73,26 @@ void capture_frames(struct device *capture_device) {
   }
 }
 
+static void print_conversion_stats(void) {
+  print_conversion_stats();
+}
+
 /**
  * @brief Capture MJPEG frames, convert to YUYV, and feed an output device.
+ *
+ * Conversion stats are reported every STATS_INTERVAL frames, at the start of
+ * each burst of rejected frames, and on exit.
  */
 void capture_to_output(struct device *capture_device,
                        struct device *output_device) {
 
   conversion_init();
 
+  // Output buffer kept across iterations when there was nothing to send
+  struct v4l2_buffer out_buf = {0};
+  int out_held = 0;
+  enum conversion_result prev_res = CONVERSION_OK;
+
   int i = 0;
   while (running) {
     printf("%d\n", i++);
@@ -90,38 +108,64 @@ void capture_to_output(struct device *capture_device,
           continue;
         errno_exit("VIDIOC_DQBUF");
       }
+      TRACE_FRAME(dqbuf, &cap_buf);
+      note_first_frame(capture_device);
       break;
     }
 
     // Dequeue output buffer
-    struct v4l2_buffer out_buf = {0};
-    out_buf.type = output_device->buf_type;
-    out_buf.memory = output_device->mem_type;
-
-    while (1) {
-      if (-1 == xioctl(output_device->fd, VIDIOC_DQBUF, &out_buf)) {
-        if (errno == EAGAIN)
-          continue;
-        errno_exit("VIDIOC_DQBUF");
+    if (!out_held) {
+      out_buf = (struct v4l2_buffer){0};
+      out_buf.type = output_device->buf_type;
+      out_buf.memory = output_device->mem_type;
+
+      while (1) {
+        if (-1 == xioctl(output_device->fd, VIDIOC_DQBUF, &out_buf)) {
+          if (errno == EAGAIN)
+            continue;
+          errno_exit("VIDIOC_DQBUF");
+        }
+        TRACE_FRAME(dqbuf, &out_buf);
+        break;
       }
-      break;
     }
 
-    // Perform MJPEG → YUYV conversion
-    jpeg_to_yuyv(capture_device->buffer[cap_buf.index],
-                 output_device->buffer[out_buf.index]);
+    // Perform MJPEG → YUYV conversion; corrupt frames repeat the last good one
+    enum conversion_result res =
+        jpeg_to_yuyv(capture_device->buffer[cap_buf.index], &cap_buf,
+                     output_device->buffer[out_buf.index]);
 
-    // Required: bytesused must be set for output device
-    out_buf.bytesused = output_device->format.fmt.pix.sizeimage;
+    if ((res != CONVERSION_OK && prev_res == CONVERSION_OK) ||
+        i % STATS_INTERVAL == 0)
+      print_conversion_stats();
+    prev_res = res;
 
     // Requeue both buffers
+    TRACE_FRAME(qbuf, &cap_buf);
     if (-1 == xioctl(capture_device->fd, VIDIOC_QBUF, &cap_buf))
       errno_exit("VIDIOC_QBUF");
 
+    // No good frame decoded yet: hold the output buffer rather than send junk
+    out_held = (res == CONVERSION_DROP);
+    if (out_held)
+      continue;
+
+    // Required: bytesused must be set for output device
+    out_buf.bytesused = output_device->format.fmt.pix.sizeimage;
+
+    // Carry the capture timestamp through so the sink, the qbuf probe and the
+    // kernel's v4l2_qbuf event all identify the frame being delivered
+    out_buf.timestamp = cap_buf.timestamp;
+    out_buf.field = cap_buf.field;
+
+    TRACE_FRAME(qbuf, &out_buf);
     if (-1 == xioctl(output_device->fd, VIDIOC_QBUF, &out_buf))
       errno_exit("VIDIOC_QBUF");
+    note_first_frame(output_device);
   }
 
+  print_conversion_stats();
+
   conversion_deinit();
 }
 
@@ -140,12 +184,35 @@ int main(int argc, char *argv[]) {
   int width = 160;
   int height = 120;
 
-  // Initialize capture device
-  init_device(argv[1], V4L2_CAP_VIDEO_CAPTURE, width, height, &capture_device);
+  // Configurations negotiated on a previous run
+  char cache_path[PATH_MAX];
+  int have_cache_path = format_cache_path(cache_path, sizeof(cache_path)) == 0;
+  if (!have_cache_path)
+    fprintf(stderr, "device cache path too long, cache disabled\n");
+  struct format_cache cache = {0};
+  if (have_cache_path)
+    format_cache_load(cache_path, &cache);
+
+  // Bring up capture (and output) devices concurrently
+  struct device_request reqs[] = {
+      {argv[1], V4L2_CAP_VIDEO_CAPTURE, &capture_device},
+      {argc == 3 ? argv[2] : NULL, V4L2_CAP_VIDEO_OUTPUT, &output_device},
+  };
+  size_t dev_count = argc == 3 ? 2 : 1;
+  init_devices(reqs, dev_count, width, height, &cache);
+
+  format_cache_free(&cache);
+
+  // Merged into the on-disk cache, which other pipeline processes may share
+  struct format_cache_entry negotiated[2];
+  for (size_t i = 0; i < dev_count; ++i)
+    negotiated[i] = reqs[i].dev->negotiated;
+  if (have_cache_path &&
+      format_cache_save(cache_path, negotiated, dev_count) < 0)
+    fprintf(stderr, "%s: failed to save device cache\n", cache_path);
 
   // With output target
   if (argc == 3) {
-    init_device(argv[2], V4L2_CAP_VIDEO_OUTPUT, width, height, &output_device);
     capture_to_output(&capture_device, &output_device);
     deinit_device(&output_device);
   }
@@ -0,0 +1,71 @@
+#pragma once
+#include <linux/videodev2.h>
+#include <stdint.h>
+
+/**
+ * @file trace.h
+ * @brief Compile-time optional tracepoints on the frame hot path.
+ *
+ * Every tracepoint carries the V4L2 buffer type, index, sequence and
+ * timestamp (in microseconds) so it can be lined up with the kernel's own
+ * v4l2:v4l2_dqbuf / v4l2:v4l2_qbuf events in perf or trace-cmd.
+ *
+ * Select a backend at build time:
+ *   -DPIPELINE_TRACE_USDT    USDT probes via <sys/sdt.h>, provider "pipeline"
+ *                            (e.g. perf probe sdt_pipeline:dqbuf)
+ *   -DPIPELINE_TRACE_MARKER  ftrace trace_marker writes, visible in the
+ *                            same trace-cmd buffer as the kernel events
+ *
+ * Without either flag TRACE_FRAME() expands to nothing.
+ */
+
+#define TRACE_TS_US(b)                                                         \
+  ((uint64_t)(b)->timestamp.tv_sec * 1000000u + (b)->timestamp.tv_usec)
+
+#if defined(PIPELINE_TRACE_USDT)
+#include <sys/sdt.h>
+
+#define TRACE_FRAME(name, b)                                                   \
+  DTRACE_PROBE4(pipeline, name, (b)->type, (b)->index, (b)->sequence,          \
+                TRACE_TS_US(b))
+
+#elif defined(PIPELINE_TRACE_MARKER)
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * @brief Write one line to the ftrace marker file.
+ *
+ * The marker is opened on first use; if tracefs is not available the
+ * tracepoint silently becomes a no-op.
+ */
+static inline void trace_marker_frame(const char *name,
+                                      const struct v4l2_buffer *b) {
+  static int fd = -2;
+  if (fd == -2) {
+    fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+      fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+  }
+  if (fd < 0)
+    return;
+
+  char line[128];
+  int len = snprintf(line, sizeof(line),
+                     "pipeline:%s type=%u index=%u seq=%u ts=%llu\n", name,
+                     b->type, b->index, b->sequence,
+                     (unsigned long long)TRACE_TS_US(b));
+  if (len > 0)
+    (void)write(fd, line, len);
+}
+
+#define TRACE_FRAME(name, b) trace_marker_frame(#name, (b))
+
+#else
+
+#define TRACE_FRAME(name, b)                                                   \
+  do {                                                                         \
+  } while (0)
+
+#endif
@@ -1,9 +1,11 @@
 #include <fcntl.h>    // for open()
 #include <inttypes.h> // for uint32_t
+#include <pthread.h>  // for pthread_create()
 #include <stdbool.h>  // for bool
 #include <stdio.h>
 #include <sys/ioctl.h> // for ioctl()
 #include <sys/mman.h>  // for mmap()
+#include <time.h>      // for clock_gettime()
 #include <unistd.h>    // for close()
 
 #include <linux/videodev2.h>
@@ -34,16 +36,54 @@ static const struct bit_to_cap_name cap_table[] = {
     {V4L2_CAP_VIDEO_M2M_MPLANE, "VIDEO_M2M_MPLANE"},
     {V4L2_CAP_VIDEO_M2M, "VIDEO_M2M"}};
 
+static double elapsed_ms(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1e3 +
+         (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/*
+ * Skip S_FMT when the device still holds the format it negotiated last time.
+ * G_FMT is cheap; S_FMT on UVC devices round-trips to the camera.
+ */
+static bool format_matches(struct device *dev,
+                           const struct format_cache_entry *hit) {
+  struct v4l2_format cur = {0};
+  cur.type = dev->buf_type;
+  if (-1 == xioctl(dev->fd, VIDIOC_G_FMT, &cur))
+    return false;
+  if (cur.fmt.pix.pixelformat != hit->pixelformat ||
+      cur.fmt.pix.width != hit->width || cur.fmt.pix.height != hit->height ||
+      cur.fmt.pix.bytesperline != hit->bytesperline ||
+      cur.fmt.pix.sizeimage != hit->sizeimage)
+    return false;
+  dev->format = cur;
+  return true;
+}
+
+static bool interval_matches(struct device *dev,
+                             const struct format_cache_entry *hit) {
+  struct v4l2_streamparm cur = {0};
+  cur.type = dev->buf_type;
+  if (-1 == xioctl(dev->fd, VIDIOC_G_PARM, &cur))
+    return false;
+  return cur.parm.capture.timeperframe.numerator ==
+             hit->timeperframe.numerator &&
+         cur.parm.capture.timeperframe.denominator ==
+             hit->timeperframe.denominator;
+}
+
 /**
- * init_device() - Open a V4L2 device and verify the required capability.
+ * init_device() - Open a V4L2 device, configure it and start streaming.
  *
  * @dev_node:   Path to the device node (e.g. "/dev/video0").
  * @device_cap: Required V4L2_CAP_* bit (e.g. V4L2_CAP_VIDEO_CAPTURE).
+ * @width:      Requested frame width.
+ * @height:     Requested frame height.
+ * @cache:      Previously negotiated configurations, or NULL.
  * @device:     Output Device structure to initialize.
  *
- * Returns: INIT_SUCCESS on success, or an INIT_* error code indicating
- *          why initialization failed.
- *
  * This function:
  *   1. Opens the provided device node with O_RDWR | O_NONBLOCK.
  *   2. Queries device capabilities via VIDIOC_QUERYCAP.
@@ -52,30 +92,36 @@ static const struct bit_to_cap_name cap_table[] = {
  *      (V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_BUF_TYPE_VIDEO_OUTPUT, etc.).
  *   5. Initializes dev->format.type, which is required before calling
  *      VIDIOC_G_FMT or VIDIOC_S_FMT.
+ *   6. Sets format and frame interval, unless @cache has an entry for this
+ *      device and request that the device already matches.
+ *   7. Maps buffers and starts streaming.
  *
- * The Device struct is zero-initialized on entry. On failure, this function
- * returns an INIT_* code instead of exiting the program.
+ * The negotiated configuration is left in dev->negotiated for the caller
+ * to store back into the cache. Fatal errors exit the program. Safe to call
+ * concurrently for different devices.
  */
 void init_device(char *dev_node, uint32_t device_cap, int width, int height,
-                 struct device *dev) {
+                 const struct format_cache *cache, struct device *dev) {
   *dev = (typeof(*dev)){0};
   dev->name = dev_node;
-  printf("%s: init\n", dev->name);
+  clock_gettime(CLOCK_MONOTONIC, &dev->init_start);
+  V4L2_DBG("%s: init\n", dev->name);
   dev->fd = open(dev_node, O_RDWR /* required */ | O_NONBLOCK, 0);
   if (dev->fd == -1) {
     errno_exit("open");
   }
-  printf("%s: opened as %d\n", dev_node, dev->fd);
+  V4L2_DBG("%s: opened as %d\n", dev_node, dev->fd);
 
-  struct v4l2_capability caps;
-  xioctl(dev->fd, VIDIOC_QUERYCAP, &caps);
+  if (-1 == xioctl(dev->fd, VIDIOC_QUERYCAP, &dev->caps)) {
+    errno_exit("VIDIOC_QUERYCAP");
+  }
 
-  printf("Device Caps:\n");
+  V4L2_DBG("Device Caps:\n");
   for (int i = 0; i < sizeof(cap_table) / sizeof(struct bit_to_cap_name); ++i) {
-    if (cap_table[i].bit & caps.device_caps) // check supported device_caps
+    if (cap_table[i].bit & dev->caps.device_caps) // check supported device_caps
     {
       // dev_cap matches
-      printf("%s\n", cap_table[i].name);
+      V4L2_DBG("%s\n", cap_table[i].name);
       if (cap_table[i].bit == device_cap) // check if we can configure device
       {
         switch (device_cap) {
@@ -99,50 +145,134 @@ void init_device(char *dev_node, uint32_t device_cap, int width, int height,
     // req types
     dev->format.type = dev->buf_type;
   }
+
+  const struct format_cache_entry *hit = NULL;
+  if (cache && dev->buf_type)
+    hit = format_cache_find(cache, &dev->caps, dev->buf_type, width, height);
+  bool fmt_cached = hit && format_matches(dev, hit);
+  bool parm_cached = true;
+  struct v4l2_fract interval = {0};
+
   // Format negotitation -> REQBUF -> QUERYBUF -> mmap() -> QBUF ->
   // VIDIOC_STREAMON 2-4 buffers each for capture and output, at least 2 buffer
   // to stop hardware stalls
-  printf("%s: S_FMT\n", dev->name);
+  V4L2_DBG("%s: S_FMT%s\n", dev->name, fmt_cached ? " (cached)" : "");
   if (dev->format.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
-    dev->format.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
-    dev->format.fmt.pix.width = width;
-    dev->format.fmt.pix.height = height;
-    if (-1 == xioctl(dev->fd, VIDIOC_S_FMT, &dev->format)) {
-      errno_exit("VIDIOC_S_FMT");
+    if (!fmt_cached) {
+      dev->format.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+      dev->format.fmt.pix.width = width;
+      dev->format.fmt.pix.height = height;
+      if (-1 == xioctl(dev->fd, VIDIOC_S_FMT, &dev->format)) {
+        errno_exit("VIDIOC_S_FMT");
+      }
     }
 
-    struct v4l2_streamparm fps = {0};
-    fps.type = dev->buf_type;
-    fps.parm.capture.timeperframe.numerator = 1;
-    fps.parm.capture.timeperframe.denominator = 5; // 5 fps
-    if (-1 == xioctl(dev->fd, VIDIOC_S_PARM, &fps)) {
-      errno_exit("VIDIOC_S_PARM");
+    parm_cached = fmt_cached && interval_matches(dev, hit);
+    if (parm_cached) {
+      interval = hit->timeperframe;
+    } else {
+      struct v4l2_streamparm fps = {0};
+      fps.type = dev->buf_type;
+      fps.parm.capture.timeperframe.numerator = 1;
+      fps.parm.capture.timeperframe.denominator = 5; // 5 fps
+      if (-1 == xioctl(dev->fd, VIDIOC_S_PARM, &fps)) {
+        errno_exit("VIDIOC_S_PARM");
+      }
+      interval = fps.parm.capture.timeperframe; // As adjusted by the driver
     }
   } else if (dev->format.type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
-    dev->format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    dev->format.fmt.pix.width = width;
-    dev->format.fmt.pix.height = height;
-    dev->format.fmt.pix.bytesperline = width * YUYV_BYTES_PER_PIXEL;
-    dev->format.fmt.pix.sizeimage = width * height * YUYV_BYTES_PER_PIXEL;
-    if (-1 == xioctl(dev->fd, VIDIOC_S_FMT, &dev->format)) {
-      errno_exit("VIDIOC_S_FMT");
+    if (!fmt_cached) {
+      dev->format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+      dev->format.fmt.pix.width = width;
+      dev->format.fmt.pix.height = height;
+      dev->format.fmt.pix.bytesperline = width * YUYV_BYTES_PER_PIXEL;
+      dev->format.fmt.pix.sizeimage = width * height * YUYV_BYTES_PER_PIXEL;
+      if (-1 == xioctl(dev->fd, VIDIOC_S_FMT, &dev->format)) {
+        errno_exit("VIDIOC_S_FMT");
+      }
     }
   } else {
     fprintf(stderr, "UNSUPPORTED\n");
     exit(EXIT_FAILURE);
   }
+  dev->from_cache = fmt_cached && parm_cached;
+
+  struct format_cache_entry *neg = &dev->negotiated;
+  format_cache_key(neg, &dev->caps);
+  neg->buf_type = dev->buf_type;
+  neg->req_width = width;
+  neg->req_height = height;
+  neg->pixelformat = dev->format.fmt.pix.pixelformat;
+  neg->width = dev->format.fmt.pix.width;
+  neg->height = dev->format.fmt.pix.height;
+  neg->bytesperline = dev->format.fmt.pix.bytesperline;
+  neg->sizeimage = dev->format.fmt.pix.sizeimage;
+  neg->timeperframe = interval;
+
   mmap_buf(4, dev);
-  printf("%s: STREAMON\n", dev->name);
+  V4L2_DBG("%s: STREAMON\n", dev->name);
   start_stream(dev);
+
+  printf("%s: ready in %.1f ms (%s)\n", dev->name, elapsed_ms(&dev->init_start),
+         dev->from_cache ? "cached config" : "negotiated");
+}
+
+struct init_job {
+  struct device_request *req;
+  int width;
+  int height;
+  const struct format_cache *cache;
+};
+
+static void *init_device_thread(void *arg) {
+  struct init_job *job = arg;
+  init_device(job->req->dev_node, job->req->device_cap, job->width,
+              job->height, job->cache, job->req->dev);
+  return NULL;
+}
+
+void init_devices(struct device_request *reqs, size_t count, int width,
+                  int height, const struct format_cache *cache) {
+  struct init_job *jobs = calloc(count, sizeof(*jobs));
+  pthread_t *threads = calloc(count, sizeof(*threads));
+  bool *started = calloc(count, sizeof(*started));
+  if (!jobs || !threads || !started) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    jobs[i] = (struct init_job){&reqs[i], width, height, cache};
+    started[i] =
+        pthread_create(&threads[i], NULL, init_device_thread, &jobs[i]) == 0;
+    if (!started[i]) // Fall back to serial bring-up for this device
+      init_device_thread(&jobs[i]);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+
+  free(started);
+  free(threads);
+  free(jobs);
+}
+
+void note_first_frame(struct device *dev) {
+  if (dev->first_frame_seen)
+    return;
+  dev->first_frame_seen = 1;
+  printf("%s: first frame after %.1f ms\n", dev->name,
+         elapsed_ms(&dev->init_start));
 }
 
 void deinit_device(struct device *device) {
   // VIDIOC_STREAMOFF -> mumap() -> buffer free -> close device
-  printf("%s: STREAMOFF\n", device->name);
+  V4L2_DBG("%s: STREAMOFF\n", device->name);
   stop_stream(device);
-  printf("%s: MUMAP\n", device->name);
+  V4L2_DBG("%s: MUMAP\n", device->name);
   munmap_buf(device);
-  printf("%s: CLOSE\n", device->name);
+  V4L2_DBG("%s: CLOSE\n", device->name);
   close(device->fd);
 }
 
@@ -161,7 +291,7 @@ void mmap_buf(int count, struct device *dev) {
   dev->mem_type = V4L2_MEMORY_MMAP;
   dev->buffer_count = count; // Each REQBUF call gives you count buffers, not
                              // increment/decrement
-  printf("%s: REQBUF\n", dev->name);
+  V4L2_DBG("%s: REQBUF\n", dev->name);
   req_buf(dev);
   if (dev->buffer_count < 2) {
     fprintf(stderr, "Out of memory on device\n");
@@ -172,7 +302,7 @@ void mmap_buf(int count, struct device *dev) {
     fprintf(stderr, "Out of memory\n");
     exit(EXIT_FAILURE);
   }
-  printf("%s: MMAP\n", dev->name);
+  V4L2_DBG("%s: MMAP\n", dev->name);
   for (int i = 0; i < dev->buffer_count; ++i) {
     struct v4l2_buffer buf = {0};
     buf.index = i;
@@ -1,6 +1,7 @@
 #pragma once
 #include "buffer.h"
 #include "conversion.h"
+#include "format_cache.h"
 #include <errno.h>
 #include <linux/videodev2.h>
 #include <stdint.h>
@@ -8,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 
 /**
  * @file v4l2_helper.h
@@ -19,8 +21,21 @@
  *   - Requesting / mapping buffers (REQBUFS, QUERYBUF)
  *   - Starting/stopping streaming
  *   - Safe cleanup of memory-mapped buffers
+ *   - Concurrent bring-up of several devices
  */
 
+/**
+ * Per-step bring-up logging. Compiled out unless built with
+ * -DPIPELINE_VERBOSE, since it serialises on stdout during parallel init.
+ */
+#ifdef PIPELINE_VERBOSE
+#define V4L2_DBG(...) printf(__VA_ARGS__)
+#else
+#define V4L2_DBG(...)                                                          \
+  do {                                                                         \
+  } while (0)
+#endif
+
 struct device {
   char *name; ///< Device path, e.g. "/dev/video0"
   int fd;     ///< File descriptor returned by open()
@@ -33,13 +48,48 @@ struct device {
 
   struct buffer *buffer; ///< Array of mapped buffers
   size_t buffer_count;   ///< Number of buffers
+
+  struct v4l2_capability caps;          ///< VIDIOC_QUERYCAP result
+  struct format_cache_entry negotiated; ///< Configuration to cache on exit
+  int from_cache;             ///< Cached config applied, S_FMT/S_PARM skipped
+  struct timespec init_start; ///< When init_device() opened the node
+  int first_frame_seen;       ///< Set once note_first_frame() has reported
+};
+
+/**
+ * @brief Parameters for one device in init_devices().
+ */
+struct device_request {
+  char *dev_node;      ///< Device path, e.g. "/dev/video0"
+  uint32_t device_cap; ///< Required V4L2_CAP_* bit
+  struct device *dev;  ///< Device structure to initialize
 };
 
 /**
  * @brief Open the device, verify its capability, set formats, allocate buffers.
+ *
+ * @p cache may be NULL; otherwise a matching entry lets the device skip
+ * format negotiation when it is already configured as cached.
  */
 void init_device(char *dev_node, uint32_t device_cap, int width, int height,
-                 struct device *dev);
+                 const struct format_cache *cache, struct device *dev);
+
+/**
+ * @brief Run init_device() for every request concurrently, one thread each.
+ *
+ * @p cache is only read during init; merge each dev->negotiated back into it
+ * afterwards with format_cache_update().
+ */
+void init_devices(struct device_request *reqs, size_t count, int width,
+                  int height, const struct format_cache *cache);
+
+/**
+ * @brief Report time from init_device() to the device's first frame.
+ *
+ * Call after each capture DQBUF, or after each output QBUF to time the
+ * first frame handed to the sink. Cheap; only the first call prints.
+ */
+void note_first_frame(struct device *dev);
 
 /**
  * @brief Stop streaming, unmap buffers, and close the device.